@@ -2,12 +2,16 @@
 #include "./ui_mainwindow.h"
 
 #include <QFileDialog>
+#include <QMessageBox>
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
 {
     ui->setupUi(this);
+
+    connect(ui->siImageViewer->statistics(), &SiImageStatistics::regionStatisticsReady,
+            this, &MainWindow::showRegionStatistics);
 }
 
 MainWindow::~MainWindow()
@@ -25,8 +29,19 @@ void MainWindow::on_btOpenImage_clicked()
     if (fd.exec()) {
         auto selectedFiles = fd.selectedFiles();
         if (selectedFiles.size() > 0) {
-            ui->siImageViewer->setImage(QImage(selectedFiles.first()));
+            auto decoder = std::make_shared<SiImageReaderDecoder>(selectedFiles.first());
+            if (!ui->siImageViewer->setImageDecoder(decoder)) {
+                QMessageBox::warning(this, tr("Open Image"),
+                                     tr("Could not read image %1.").arg(selectedFiles.first()));
+            }
         }
     }
 }
 
+void MainWindow::showRegionStatistics(const SiStatistics &statistics)
+{
+    ui->statusbar->showMessage(tr("Visible region: R %1-%2  G %3-%4  B %5-%6")
+                                   .arg(statistics.min[0]).arg(statistics.max[0])
+                                   .arg(statistics.min[1]).arg(statistics.max[1])
+                                   .arg(statistics.min[2]).arg(statistics.max[2]));
+}
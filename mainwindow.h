@@ -3,6 +3,8 @@
 
 #include <QMainWindow>
 
+#include "siimagestatistics.h"
+
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
 QT_END_NAMESPACE
@@ -17,6 +19,7 @@ public:
 
 private slots:
     void on_btOpenImage_clicked();
+    void showRegionStatistics(const SiStatistics& statistics);
 
 private:
     Ui::MainWindow *ui;
@@ -0,0 +1,61 @@
+/*
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+SPDX-License-Identifier: MIT
+Copyright (c) 2023 Stefan Isak <http://sisak.at>.
+
+Permission is hereby  granted, free of charge, to any  person obtaining a copy
+of this software and associated  documentation files (the "Software"), to deal
+in the Software  without restriction, including without  limitation the rights
+to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "siimagedecoder.h"
+
+#include <QImageIOHandler>
+#include <QImageReader>
+
+SiImageReaderDecoder::SiImageReaderDecoder(const QString &fileName)
+    : m_fileName(fileName)
+{
+    // only reads the header
+    QImageReader reader(m_fileName);
+    m_size = reader.size();
+    m_supportsRegions = reader.supportsOption(QImageIOHandler::ClipRect)
+                        && reader.supportsOption(QImageIOHandler::ScaledSize);
+}
+
+QSize SiImageReaderDecoder::size() const
+{
+    return m_size;
+}
+
+bool SiImageReaderDecoder::supportsRegions() const
+{
+    return m_supportsRegions;
+}
+
+QImage SiImageReaderDecoder::decode(const QRect &clip, const QSize &scaledSize) const
+{
+    // a reader can only be used for one read, create a new one per request
+    QImageReader reader(m_fileName);
+    if (clip != QRect(QPoint(0, 0), m_size)) {
+        reader.setClipRect(clip);
+    }
+    if (scaledSize != clip.size()) {
+        reader.setScaledSize(scaledSize);
+    }
+    return reader.read();
+}
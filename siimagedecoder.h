@@ -0,0 +1,80 @@
+/*
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+SPDX-License-Identifier: MIT
+Copyright (c) 2023 Stefan Isak <http://sisak.at>.
+
+Permission is hereby  granted, free of charge, to any  person obtaining a copy
+of this software and associated  documentation files (the "Software"), to deal
+in the Software  without restriction, including without  limitation the rights
+to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef SIIMAGEDECODER_H
+#define SIIMAGEDECODER_H
+
+#include <QImage>
+#include <QRect>
+#include <QSize>
+#include <QString>
+
+class SiImageDecoder
+{
+public:
+    virtual ~SiImageDecoder() = default;
+
+    /**
+     * @brief Gets the full resolution size of the image.
+     * @return Image size, invalid if the image cannot be read.
+     */
+    virtual QSize size() const = 0;
+
+    /**
+     * @brief Checks if regions can be decoded without decoding the whole image.
+     * @return False if every decode call has to read the whole image.
+     */
+    virtual bool supportsRegions() const = 0;
+
+    /**
+     * @brief Decodes a region of the image at the requested resolution.
+     * May be called concurrently from worker threads.
+     * @param clip Region in full resolution pixel coordinates.
+     * @param scaledSize Size of the resulting image.
+     * @return Decoded region, a null image on failure.
+     */
+    virtual QImage decode(const QRect& clip, const QSize& scaledSize) const = 0;
+};
+
+/**
+ * @brief Decodes image files with QImageReader. Formats supporting it
+ * (e.g. JPEG) skip the pixels outside the clip rect and decode directly at
+ * the scaled size. Others (e.g. PNG) always decode the whole image.
+ */
+class SiImageReaderDecoder : public SiImageDecoder
+{
+public:
+    explicit SiImageReaderDecoder(const QString& fileName);
+
+    QSize size() const override;
+    bool supportsRegions() const override;
+    QImage decode(const QRect& clip, const QSize& scaledSize) const override;
+
+private:
+    QString m_fileName;
+    QSize m_size;
+    bool m_supportsRegions;
+};
+
+#endif // SIIMAGEDECODER_H
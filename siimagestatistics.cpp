@@ -0,0 +1,408 @@
+/*
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+SPDX-License-Identifier: MIT
+Copyright (c) 2023 Stefan Isak <http://sisak.at>.
+
+Permission is hereby  granted, free of charge, to any  person obtaining a copy
+of this software and associated  documentation files (the "Software"), to deal
+in the Software  without restriction, including without  limitation the rights
+to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "siimagestatistics.h"
+
+#include <QtConcurrent/QtConcurrentMap>
+#include <QtConcurrent/QtConcurrentRun>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace {
+
+const int BAND_HEIGHT = 64;              // rows per band, the unit of work and of incremental updates
+const int DECODER_MAX_PIXELS = 1 << 22; // resolution of the single decode analyzed for decoder images
+
+using Counters = std::array<std::array<quint32, SiHistogram::BINS>, SiHistogram::CHANNELS>;
+
+/**
+ * @brief Adds the pixels of the rows [top, bottom) and columns [left, left + width) to the histogram.
+ */
+void accumulate(SiHistogram& histogram, const QImage& image, int left, int width, int top, int bottom)
+{
+    // two sets of counters for even and odd pixels, so runs of equal
+    // pixels do not serialize on incrementing the same bins
+    Counters even{};
+    Counters odd{};
+
+    for (int y = top; y < bottom; ++y) {
+        const uchar* line = image.constScanLine(y) + left * SiHistogram::CHANNELS;
+        int x = 0;
+        for (; x + 1 < width; x += 2) {
+            const uchar* p = line + x * SiHistogram::CHANNELS;
+            even[0][p[0]]++;
+            even[1][p[1]]++;
+            even[2][p[2]]++;
+            even[3][p[3]]++;
+            odd[0][p[4]]++;
+            odd[1][p[5]]++;
+            odd[2][p[6]]++;
+            odd[3][p[7]]++;
+        }
+        if (x < width) {
+            const uchar* p = line + x * SiHistogram::CHANNELS;
+            even[0][p[0]]++;
+            even[1][p[1]]++;
+            even[2][p[2]]++;
+            even[3][p[3]]++;
+        }
+    }
+
+    for (int c = 0; c < SiHistogram::CHANNELS; ++c) {
+        for (int i = 0; i < SiHistogram::BINS; ++i) {
+            histogram.bins[c][i] += even[c][i] + odd[c][i];
+        }
+    }
+    histogram.pixelCount += quint64(width) * (bottom - top);
+}
+
+/**
+ * @brief Computes the histogram of one band of rows inside an area of the image.
+ */
+struct HistogramBand
+{
+    using result_type = SiHistogram;
+
+    QImage image;
+    QRect area;
+
+    SiHistogram operator()(int band) const
+    {
+        SiHistogram histogram;
+        int top = area.top() + band * BAND_HEIGHT;
+        int bottom = qMin(top + BAND_HEIGHT, area.bottom() + 1);
+        accumulate(histogram, image, area.left(), area.width(), top, bottom);
+        return histogram;
+    }
+};
+
+void addHistogram(SiHistogram& result, const SiHistogram& band)
+{
+    result.add(band);
+}
+
+std::vector<int> bandIndices(int height)
+{
+    std::vector<int> bands((height + BAND_HEIGHT - 1) / BAND_HEIGHT);
+    std::iota(bands.begin(), bands.end(), 0);
+    return bands;
+}
+
+SiStatistics summarize(const SiHistogram& histogram, const QRect& region)
+{
+    SiStatistics statistics;
+    statistics.region = region;
+    statistics.histogram = histogram;
+
+    if (histogram.pixelCount == 0) {
+        return statistics;
+    }
+
+    for (int c = 0; c < SiHistogram::CHANNELS; ++c) {
+        const auto& bins = histogram.bins[c];
+        double sum = 0.0;
+        double sumSquares = 0.0;
+        int min = -1;
+        int max = 0;
+        for (int i = 0; i < SiHistogram::BINS; ++i) {
+            if (bins[i] == 0) {
+                continue;
+            }
+            if (min < 0) {
+                min = i;
+            }
+            max = i;
+            sum += 1.0 * i * bins[i];
+            sumSquares += 1.0 * i * i * bins[i];
+        }
+
+        double mean = sum / histogram.pixelCount;
+        statistics.min[c] = min;
+        statistics.max[c] = max;
+        statistics.mean[c] = mean;
+        statistics.stdDev[c] = std::sqrt(std::max(0.0, sumSquares / histogram.pixelCount - mean * mean));
+    }
+    return statistics;
+}
+
+/**
+ * @brief Maps a region of the full resolution image onto pixels covering a part of it.
+ * @param rect Region in full resolution pixels.
+ * @param image Pixels, possibly at reduced resolution.
+ * @param imageRect Region covered by the pixels in full resolution pixels.
+ * @return Region in pixels of the image.
+ */
+QRect mapToImage(const QRect& rect, const QImage& image, const QRect& imageRect)
+{
+    double scaleX = 1.0 * image.width() / imageRect.width();
+    double scaleY = 1.0 * image.height() / imageRect.height();
+    QRectF mapped((rect.x() - imageRect.x()) * scaleX,
+                  (rect.y() - imageRect.y()) * scaleY,
+                  rect.width() * scaleX,
+                  rect.height() * scaleY);
+    return mapped.toAlignedRect().intersected(image.rect());
+}
+
+QSize boundedSize(const QSize& size)
+{
+    double pixels = 1.0 * size.width() * size.height();
+    if (pixels <= DECODER_MAX_PIXELS) {
+        return size;
+    }
+    double factor = std::sqrt(DECODER_MAX_PIXELS / pixels);
+    return QSize(qMax(1, qRound(size.width() * factor)), qMax(1, qRound(size.height() * factor)));
+}
+
+} // namespace
+
+void SiHistogram::add(const SiHistogram &other)
+{
+    for (int c = 0; c < CHANNELS; ++c) {
+        for (int i = 0; i < BINS; ++i) {
+            bins[c][i] += other.bins[c][i];
+        }
+    }
+    pixelCount += other.pixelCount;
+}
+
+int SiStatistics::percentile(int channel, double fraction) const
+{
+    double target = fraction * histogram.pixelCount;
+    quint64 count = 0;
+    for (int i = 0; i < SiHistogram::BINS; ++i) {
+        count += histogram.bins[channel][i];
+        if (count > 0 && count >= target) {
+            return i;
+        }
+    }
+    return SiHistogram::BINS - 1;
+}
+
+SiImageStatistics::SiImageStatistics(QObject *parent) : QObject(parent)
+{
+    qRegisterMetaType<SiStatistics>();
+
+    connect(&m_decodeWatcher, &QFutureWatcher<QImage>::finished, this, &SiImageStatistics::imageDecoded);
+    connect(&m_bandWatcher, &QFutureWatcher<SiHistogram>::finished, this, &SiImageStatistics::bandsComputed);
+    connect(&m_regionWatcher, &QFutureWatcher<SiHistogram>::finished, this, &SiImageStatistics::regionComputed);
+}
+
+void SiImageStatistics::setImage(const QImage &image)
+{
+    m_image = image.convertToFormat(QImage::Format_RGBA8888);
+    m_decoder.reset();
+    m_size = m_image.size();
+    m_regionImage = QImage();
+    m_generation++;
+    m_pendingRegion = QRect();
+    resetBands();
+}
+
+void SiImageStatistics::setImageDecoder(std::shared_ptr<SiImageDecoder> decoder)
+{
+    m_image = QImage();
+    m_size = decoder->size().expandedTo(QSize(0, 0));
+    m_decoder = std::move(decoder);
+    m_regionImage = QImage();
+    m_generation++;
+    m_pendingRegion = QRect();
+    m_statisticsCurrent = false;
+    m_bands.clear();
+    m_dirtyBands.clear();
+
+    // a single decode, decoding bands would read sequential formats (e.g. JPEG)
+    // from the start of the file again for every band
+    auto source = m_decoder;
+    QRect rect(QPoint(0, 0), m_size);
+    auto scaledSize = boundedSize(m_size);
+    m_decodeGeneration = m_generation;
+    m_decodeWatcher.setFuture(QtConcurrent::run([source, rect, scaledSize]() {
+        return source->decode(rect, scaledSize).convertToFormat(QImage::Format_RGBA8888);
+    }));
+}
+
+void SiImageStatistics::setRegionImage(const QImage &image, const QRect &rect)
+{
+    m_regionImage = image.convertToFormat(QImage::Format_RGBA8888);
+    m_regionImageRect = rect;
+}
+
+void SiImageStatistics::updateImage(const QImage &image, const QRect &rect)
+{
+    if (m_decoder || image.size() != m_size) {
+        setImage(image);
+        return;
+    }
+
+    m_image = image.convertToFormat(QImage::Format_RGBA8888);
+
+    auto region = rect.intersected(m_image.rect());
+    if (region.isEmpty()) {
+        return;
+    }
+    m_statisticsCurrent = false;
+    for (int band = region.top() / BAND_HEIGHT; band <= region.bottom() / BAND_HEIGHT; ++band) {
+        m_dirtyBands[band] = true;
+    }
+    computeDirtyBands();
+}
+
+void SiImageStatistics::computeRegion(const QRect &rect)
+{
+    auto region = rect.intersected(QRect(QPoint(0, 0), m_size));
+    if (region.isEmpty()) {
+        return;
+    }
+
+    // only the latest request is of interest
+    if (m_regionWatcher.isRunning()) {
+        m_pendingRegion = region;
+        return;
+    }
+    startRegion(region);
+}
+
+const SiStatistics &SiImageStatistics::statistics() const
+{
+    return m_statistics;
+}
+
+void SiImageStatistics::imageDecoded()
+{
+    // the image changed while decoding
+    if (m_decodeGeneration != m_generation) {
+        return;
+    }
+
+    // analyzed like an image set directly, regions requested meanwhile are kept
+    m_image = m_decodeWatcher.result();
+    resetBands();
+}
+
+void SiImageStatistics::bandsComputed()
+{
+    // results of an outdated image are dropped, its bands are all dirty again
+    if (m_bandGeneration == m_generation) {
+        auto future = m_bandWatcher.future();
+        for (size_t i = 0; i < m_runningBands.size(); ++i) {
+            m_bands[m_runningBands[i]] = future.resultAt(static_cast<int>(i));
+        }
+    }
+    computeDirtyBands();
+}
+
+void SiImageStatistics::regionComputed()
+{
+    if (m_regionGeneration == m_generation) {
+        emit regionStatisticsReady(summarize(m_regionWatcher.result(), m_runningRegion));
+    }
+    if (!m_pendingRegion.isEmpty()) {
+        startRegion(m_pendingRegion);
+    }
+}
+
+void SiImageStatistics::computeDirtyBands()
+{
+    // restarted once the running computation finished
+    if (m_bandWatcher.isRunning()) {
+        return;
+    }
+
+    m_runningBands.clear();
+    for (size_t band = 0; band < m_dirtyBands.size(); ++band) {
+        if (m_dirtyBands[band]) {
+            m_dirtyBands[band] = false;
+            m_runningBands.push_back(static_cast<int>(band));
+        }
+    }
+
+    if (m_runningBands.empty()) {
+        // up to date, combining the cached bands is cheap compared to the pixels
+        SiHistogram histogram;
+        for (const auto& band : m_bands) {
+            histogram.add(band);
+        }
+        m_statistics = summarize(histogram, QRect(QPoint(0, 0), m_size));
+        m_statisticsCurrent = true;
+        emit statisticsReady(m_statistics);
+
+        // a request for the whole image waited for these statistics
+        if (!m_pendingRegion.isEmpty() && !m_regionWatcher.isRunning()) {
+            startRegion(m_pendingRegion);
+        }
+        return;
+    }
+
+    m_bandGeneration = m_generation;
+    m_bandWatcher.setFuture(QtConcurrent::mapped(m_runningBands, HistogramBand{m_image, m_image.rect()}));
+}
+
+void SiImageStatistics::resetBands()
+{
+    m_statisticsCurrent = false;
+
+    auto bandCount = bandIndices(m_image.height()).size();
+    m_bands.assign(bandCount, SiHistogram());
+    m_dirtyBands.assign(bandCount, true);
+    computeDirtyBands();
+}
+
+void SiImageStatistics::startRegion(const QRect &rect)
+{
+    // the whole image is visible, e.g. at fit zoom, reuse its statistics once computed
+    if (rect == QRect(QPoint(0, 0), m_size)) {
+        m_pendingRegion = m_statisticsCurrent ? QRect() : rect;
+        if (m_statisticsCurrent) {
+            emit regionStatisticsReady(m_statistics);
+        }
+        return;
+    }
+
+    // decoder images are analyzed once decoded, preferably from the region pixels
+    auto source = m_image;
+    QRect sourceRect(QPoint(0, 0), m_size);
+    if (m_decoder) {
+        if (m_image.isNull()) {
+            m_pendingRegion = rect;
+            return;
+        }
+        if (!m_regionImage.isNull() && m_regionImageRect.contains(rect)) {
+            source = m_regionImage;
+            sourceRect = m_regionImageRect;
+        }
+    }
+
+    m_pendingRegion = QRect();
+    auto area = mapToImage(rect, source, sourceRect);
+    if (area.isEmpty()) {
+        return;
+    }
+
+    m_runningRegion = rect;
+    m_regionGeneration = m_generation;
+    m_regionWatcher.setFuture(QtConcurrent::mappedReduced(bandIndices(area.height()),
+                                                          HistogramBand{source, area},
+                                                          addHistogram));
+}
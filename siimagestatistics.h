@@ -0,0 +1,167 @@
+/*
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+SPDX-License-Identifier: MIT
+Copyright (c) 2023 Stefan Isak <http://sisak.at>.
+
+Permission is hereby  granted, free of charge, to any  person obtaining a copy
+of this software and associated  documentation files (the "Software"), to deal
+in the Software  without restriction, including without  limitation the rights
+to  use, copy,  modify, merge,  publish, distribute,  sublicense, and/or  sell
+copies  of  the Software,  and  to  permit persons  to  whom  the Software  is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE  IS PROVIDED "AS  IS", WITHOUT WARRANTY  OF ANY KIND,  EXPRESS OR
+IMPLIED,  INCLUDING BUT  NOT  LIMITED TO  THE  WARRANTIES OF  MERCHANTABILITY,
+FITNESS FOR  A PARTICULAR PURPOSE AND  NONINFRINGEMENT. IN NO EVENT  SHALL THE
+AUTHORS  OR COPYRIGHT  HOLDERS  BE  LIABLE FOR  ANY  CLAIM,  DAMAGES OR  OTHER
+LIABILITY, WHETHER IN AN ACTION OF  CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE  OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef SIIMAGESTATISTICS_H
+#define SIIMAGESTATISTICS_H
+
+#include <QFutureWatcher>
+#include <QImage>
+#include <QMetaType>
+#include <QObject>
+#include <QRect>
+#include <array>
+#include <memory>
+#include <vector>
+
+#include "siimagedecoder.h"
+
+/**
+ * @brief Per-channel (R, G, B, A) histograms of 8 bit image data.
+ */
+struct SiHistogram
+{
+    static const int CHANNELS = 4;
+    static const int BINS = 256;
+
+    std::array<std::array<quint64, BINS>, CHANNELS> bins{};
+    quint64 pixelCount{0};
+
+    void add(const SiHistogram& other);
+};
+
+/**
+ * @brief Summary statistics derived from a histogram.
+ */
+struct SiStatistics
+{
+    QRect region;          // region of the image in full resolution pixels
+    SiHistogram histogram;
+    std::array<int, SiHistogram::CHANNELS> min{};
+    std::array<int, SiHistogram::CHANNELS> max{};
+    std::array<double, SiHistogram::CHANNELS> mean{};
+    std::array<double, SiHistogram::CHANNELS> stdDev{};
+
+    /**
+     * @brief Gets the smallest value with at least the given fraction of pixels below or equal.
+     * @param channel Channel index (0 = red, 1 = green, 2 = blue, 3 = alpha).
+     * @param fraction Fraction in the range 0.0 to 1.0, e.g. 0.99 for the 99th percentile.
+     * @return Channel value.
+     */
+    int percentile(int channel, double fraction) const;
+};
+
+Q_DECLARE_METATYPE(SiStatistics)
+
+/**
+ * @brief Computes histograms and summary statistics of an image on worker threads.
+ * The image is split into bands of rows whose histograms are kept, so changing a
+ * part of the image only recomputes the affected bands.
+ *
+ * Statistics of images provided by a decoder are approximate: the whole image is
+ * analyzed from a single decode at bounded resolution, regions from the pixels
+ * given to setRegionImage (e.g. the detail region of the viewer) if they cover
+ * the region. Downsampling smooths the pixels, so extremes may be missed.
+ */
+class SiImageStatistics : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SiImageStatistics(QObject *parent = nullptr);
+
+    /**
+     * @brief Sets the image and computes its statistics in the background.
+     * @param image Image to analyze.
+     */
+    void setImage(const QImage& image);
+
+    /**
+     * @brief Sets an image provided by a decoder and computes its approximate
+     * statistics in the background from a decode at bounded resolution.
+     * @param decoder Decoder providing the image pixels.
+     */
+    void setImageDecoder(std::shared_ptr<SiImageDecoder> decoder);
+
+    /**
+     * @brief Provides decoded pixels of a part of a decoder image, used for the
+     * statistics of regions inside it. Pass a null image to release them.
+     * @param image Decoded pixels, possibly at reduced resolution.
+     * @param rect Region covered by the pixels in full resolution pixels.
+     */
+    void setRegionImage(const QImage& image, const QRect& rect);
+
+    /**
+     * @brief Replaces the image and recomputes only the bands touching the changed region.
+     * Falls back to setImage if the size changed or a decoder was set.
+     * @param image Updated image.
+     * @param rect Changed region in pixels.
+     */
+    void updateImage(const QImage& image, const QRect& rect);
+
+    /**
+     * @brief Computes the statistics of a region of the current image in the background.
+     * @param rect Region in full resolution pixels.
+     */
+    void computeRegion(const QRect& rect);
+
+    /**
+     * @brief Gets the statistics of the whole image, as last reported by statisticsReady.
+     */
+    const SiStatistics& statistics() const;
+
+signals:
+    void statisticsReady(const SiStatistics& statistics);
+    void regionStatisticsReady(const SiStatistics& statistics);
+
+private slots:
+    void imageDecoded();
+    void bandsComputed();
+    void regionComputed();
+
+private:
+    QImage m_image;                         // RGBA8888, reduced resolution for decoder images
+    std::shared_ptr<SiImageDecoder> m_decoder;
+    QSize m_size;                           // full resolution image size
+    QImage m_regionImage;                   // RGBA8888, pixels of a part of a decoder image
+    QRect m_regionImageRect;                // region covered by m_regionImage (full resolution)
+    QFutureWatcher<QImage> m_decodeWatcher; // bounded decode of a decoder image
+    std::vector<SiHistogram> m_bands;       // cached histogram per band of rows
+    std::vector<bool> m_dirtyBands;         // bands which need to be recomputed
+    QFutureWatcher<SiHistogram> m_bandWatcher;
+    QFutureWatcher<SiHistogram> m_regionWatcher;
+    std::vector<int> m_runningBands;        // band indices of the running computation
+    int m_generation{0};                    // incremented with every new image
+    int m_decodeGeneration{0};              // generation of the running decode
+    int m_bandGeneration{0};                // generation of the running band computation
+    int m_regionGeneration{0};              // generation of the running region computation
+    QRect m_runningRegion;
+    QRect m_pendingRegion;                  // requested while another region was computing
+    SiStatistics m_statistics;
+    bool m_statisticsCurrent{false};        // m_statistics matches the current image
+
+    void resetBands();
+    void computeDirtyBands();
+    void startRegion(const QRect& rect);
+};
+
+#endif // SIIMAGESTATISTICS_H
@@ -25,12 +25,18 @@ SOFTWARE.
 #include "siimageviewer.h"
 
 #include <QMouseEvent>
+#include <QPolygonF>
+#include <QtConcurrent/QtConcurrentRun>
 #include <QtMath>
 #include <stdexcept>
 
 const float DEFAULT_ZOOM_STEP = 1.50f;
 const float FINE_ZOOM_STEP    = 1.05f;
 
+const int VIEW_SETTLED_DELAY_MS = 100; // delay after the last view change before refining
+const int DETAIL_MARGIN_DIVISOR = 4;   // decode a quarter of the visible size around it
+const int DETAIL_DECODE_THREADS = 2;   // a stale decode may still be running
+
 const char* VERTEX_SHADER =
     "#version 330                            \n"
     "layout(location = 0) in vec4 vtx_pos  ; \n"
@@ -66,11 +72,20 @@ SiImageViewer::SiImageViewer(QWidget *parent) : QOpenGLWidget(parent)
 
     // default zoom step
     m_zoomStep = DEFAULT_ZOOM_STEP;
+
+    m_decodePool.setMaxThreadCount(DETAIL_DECODE_THREADS);
+
+    // refine the visible region once the user stopped zooming/panning
+    m_viewSettledTimer.setSingleShot(true);
+    m_viewSettledTimer.setInterval(VIEW_SETTLED_DELAY_MS);
+    connect(&m_viewSettledTimer, &QTimer::timeout, this, &SiImageViewer::viewSettled);
+    connect(&m_detailWatcher, &QFutureWatcher<QImage>::finished, this, &SiImageViewer::detailDecoded);
 }
 
 SiImageViewer::~SiImageViewer()
 {
     glDeleteTextures(1, &m_texture);
+    glDeleteTextures(1, &m_detailTexture);
 
     glDeleteVertexArrays(1, &m_vao);
     glDeleteBuffers(1, &m_vbo);
@@ -85,25 +100,113 @@ SiImageViewer::~SiImageViewer()
 
 void SiImageViewer::setImage(const QImage &image)
 {
+    replaceImage(image);
+
+    makeCurrent();
+    setupMatrices();
+    updateMatrices();
+    centerImage();
+    doneCurrent();
+    update();
+
+    // the view may not change for an image of the same size, request the region statistics anyway
+    m_viewSettledTimer.start();
+}
+
+void SiImageViewer::updateImage(const QImage &image, const QRect &rect)
+{
+    if (image.width() != m_imageWidth || image.height() != m_imageHeight) {
+        setImage(image);
+        return;
+    }
+
+    // a decoded image is only available at reduced resolution, replace it but keep the view
+    if (m_decoder) {
+        replaceImage(image);
+        updateRegionStatistics();
+        update();
+        return;
+    }
+
     auto tmpImage = image.convertToFormat(QImage::Format_RGBA8888);
-    m_imageWidth = tmpImage.width();
-    m_imageHeight = tmpImage.height();
+    auto region = rect.intersected(tmpImage.rect());
+    if (region.isEmpty()) {
+        return;
+    }
 
+    makeCurrent();
     glBindTexture(GL_TEXTURE_2D, m_texture);
-    glTexImage2D(
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, tmpImage.width());
+    glTexSubImage2D(
         GL_TEXTURE_2D,
         0,
-        GL_RGBA8,
-        m_imageWidth,
-        m_imageHeight,
-        0,
+        region.x(),
+        region.y(),
+        region.width(),
+        region.height(),
         GL_RGBA,
         GL_UNSIGNED_BYTE,
-        tmpImage.bits());
+        tmpImage.constScanLine(region.y()) + region.x() * 4);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    doneCurrent();
+
+    m_statistics.updateImage(tmpImage, region);
+    updateRegionStatistics();
+    update();
+}
+
+bool SiImageViewer::setImageDecoder(std::shared_ptr<SiImageDecoder> decoder)
+{
+    auto size = decoder->size();
+    if (size.isEmpty()) {
+        return false;
+    }
+
+    // every region would decode the whole image again, decode it once instead
+    if (!decoder->supportsRegions()) {
+        auto image = decoder->decode(QRect(QPoint(0, 0), size), size);
+        if (image.isNull()) {
+            return false;
+        }
+        setImage(image);
+        return true;
+    }
+
+    // the base texture only needs the resolution to fit the image into the widget
+    QSize screenSize(this->width() * devicePixelRatioF(), this->height() * devicePixelRatioF());
+    auto baseSize = size.scaled(screenSize.expandedTo(QSize(1, 1)), Qt::KeepAspectRatio)
+                        .boundedTo(size)
+                        .expandedTo(QSize(1, 1));
+    auto base = decoder->decode(QRect(QPoint(0, 0), size), baseSize)
+                    .convertToFormat(QImage::Format_RGBA8888);
+    if (base.isNull()) {
+        return false;
+    }
+
+    m_decoder = std::move(decoder);
+    m_detailPending = false;
+    m_imageWidth = size.width();
+    m_imageHeight = size.height();
+    m_baseScale = 1.0f * base.width() / m_imageWidth;
+    releaseDetailTexture();
+    m_statistics.setImageDecoder(m_decoder);
+
+    makeCurrent();
+    uploadTexture(m_texture, base);
     setupMatrices();
     updateMatrices();
     centerImage();
+    doneCurrent();
     update();
+
+    // the view may not change for an image of the same size, request the region statistics anyway
+    m_viewSettledTimer.start();
+    return true;
+}
+
+SiImageStatistics *SiImageViewer::statistics()
+{
+    return &m_statistics;
 }
 
 void SiImageViewer::setBackground(const QColor &color)
@@ -166,6 +269,19 @@ void SiImageViewer::paintGL()
     glUniformMatrix4fv(m_mvpLocation, 1, GL_FALSE, m_mvp.data());
     glBindVertexArray(m_vao);
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+
+    // draw the refined region on top of the base image
+    if (m_detailScale > 0.0f) {
+        QMatrix4x4 detailMvp = m_projection * m_view * m_model * m_detailPre;
+        glBindTexture(GL_TEXTURE_2D, m_detailTexture);
+        glUniformMatrix4fv(m_mvpLocation, 1, GL_FALSE, detailMvp.data());
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+    }
+
+    if (m_mvp != m_lastMvp) {
+        m_lastMvp = m_mvp;
+        m_viewSettledTimer.start();
+    }
 }
 
 void SiImageViewer::resizeGL(int width, int height)
@@ -292,6 +408,43 @@ void SiImageViewer::focusInEvent(QFocusEvent *event)
     resetStates();
 }
 
+void SiImageViewer::viewSettled()
+{
+    refineVisibleRegion();
+    updateRegionStatistics();
+}
+
+void SiImageViewer::detailDecoded()
+{
+    // discarded because the image or the view changed while decoding
+    if (!m_detailPending) {
+        return;
+    }
+    m_detailPending = false;
+
+    auto image = m_detailWatcher.result();
+    if (image.isNull()) {
+        return;
+    }
+
+    makeCurrent();
+    uploadTexture(m_detailTexture, image);
+    doneCurrent();
+
+    m_detailRect = m_pendingDetailRect;
+    m_detailScale = m_pendingDetailScale;
+
+    // vertices are at (0,0) to (1,1), the image y-axis points upwards
+    m_detailPre.setToIdentity();
+    m_detailPre.translate(m_detailRect.x(), m_imageHeight - m_detailRect.y() - m_detailRect.height());
+    m_detailPre.scale(m_detailRect.width(), m_detailRect.height());
+    update();
+
+    // the visible region can now be analyzed from the refined pixels
+    m_statistics.setRegionImage(image, m_detailRect);
+    updateRegionStatistics();
+}
+
 void SiImageViewer::resetStates()
 {
     m_panning = false;
@@ -379,16 +532,19 @@ void SiImageViewer::setupBuffers()
 
 void SiImageViewer::setupTexture()
 {
-    // generate texture
+    // generate textures
     glGenTextures(1, &m_texture);
+    glGenTextures(1, &m_detailTexture);
 
-    // bind the texture
-    glBindTexture(GL_TEXTURE_2D, m_texture);
+    for (auto texture : {m_texture, m_detailTexture}) {
+        // bind the texture
+        glBindTexture(GL_TEXTURE_2D, texture);
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
 
     m_textureLocation = glGetUniformLocation(m_shaderProgram, "tex");
 }
@@ -448,6 +604,133 @@ void SiImageViewer::centerImage()
     m_model.translate(-m_imageWidth / 2, -m_imageHeight / 2);
 }
 
+void SiImageViewer::replaceImage(const QImage &image)
+{
+    auto tmpImage = image.convertToFormat(QImage::Format_RGBA8888);
+    m_imageWidth = tmpImage.width();
+    m_imageHeight = tmpImage.height();
+
+    m_decoder.reset();
+    m_detailPending = false;
+    m_baseScale = 1.0f;
+    releaseDetailTexture();
+    m_statistics.setImage(tmpImage);
+
+    makeCurrent();
+    uploadTexture(m_texture, tmpImage);
+    doneCurrent();
+}
+
+void SiImageViewer::uploadTexture(GLuint texture, const QImage &image)
+{
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(
+        GL_TEXTURE_2D,
+        0,
+        GL_RGBA8,
+        image.width(),
+        image.height(),
+        0,
+        GL_RGBA,
+        GL_UNSIGNED_BYTE,
+        image.bits());
+}
+
+void SiImageViewer::releaseDetailTexture()
+{
+    if (m_detailScale <= 0.0f) {
+        return;
+    }
+    m_detailScale = 0.0f;
+    m_statistics.setRegionImage(QImage(), QRect());
+
+    // a zero-size upload frees the graphics memory of the texture
+    makeCurrent();
+    glBindTexture(GL_TEXTURE_2D, m_detailTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    doneCurrent();
+}
+
+void SiImageViewer::refineVisibleRegion()
+{
+    if (!m_decoder) {
+        return;
+    }
+
+    // never decode more than the full resolution
+    auto scale = qMin(screenPixelsPerImagePixel(), 1.0f);
+    if (scale <= m_baseScale) {
+        // the base texture is sufficient, release the detail region
+        m_detailPending = false;
+        if (m_detailScale > 0.0f) {
+            releaseDetailTexture();
+            update();
+        }
+        return;
+    }
+
+    auto visible = visibleImageRect();
+    if (visible.isEmpty()) {
+        return;
+    }
+
+    // already loaded or being decoded
+    if (m_detailScale >= scale && m_detailRect.contains(visible)) {
+        return;
+    }
+    if (m_detailPending && m_pendingDetailScale >= scale && m_pendingDetailRect.contains(visible)) {
+        return;
+    }
+
+    // add a margin, so small pans do not require another decode
+    auto marginX = visible.width() / DETAIL_MARGIN_DIVISOR;
+    auto marginY = visible.height() / DETAIL_MARGIN_DIVISOR;
+    auto clip = visible.adjusted(-marginX, -marginY, marginX, marginY)
+                    .intersected(QRect(0, 0, m_imageWidth, m_imageHeight));
+    QSize scaledSize(qMax(1, qRound(clip.width() * scale)), qMax(1, qRound(clip.height() * scale)));
+
+    m_detailPending = true;
+    m_pendingDetailRect = clip;
+    m_pendingDetailScale = scale;
+
+    auto decoder = m_decoder;
+    m_detailWatcher.setFuture(QtConcurrent::run(&m_decodePool, [decoder, clip, scaledSize]() {
+        return decoder->decode(clip, scaledSize).convertToFormat(QImage::Format_RGBA8888);
+    }));
+}
+
+void SiImageViewer::updateRegionStatistics()
+{
+    auto visible = visibleImageRect();
+    if (visible.isEmpty()) {
+        return;
+    }
+    m_statistics.computeRegion(visible);
+}
+
+QRect SiImageViewer::visibleImageRect()
+{
+    // the image may be rotated, use the bounding box of all widget corners
+    QPolygonF corners;
+    for (const auto& corner : {QVector2D(0.0f, 0.0f),
+                               QVector2D(this->width(), 0.0f),
+                               QVector2D(0.0f, this->height()),
+                               QVector2D(this->width(), this->height())}) {
+        auto image = screenToImage(corner);
+        // image y-axis points upwards, pixel rows downwards
+        corners << QPointF(image.x(), m_imageHeight - image.y());
+    }
+    return corners.boundingRect().toAlignedRect().intersected(QRect(0, 0, m_imageWidth, m_imageHeight));
+}
+
+float SiImageViewer::screenPixelsPerImagePixel()
+{
+    // length of one screen pixel in the image is independent of the rotation
+    auto a = screenToImage(QVector2D(0.0f, 0.0f));
+    auto b = screenToImage(QVector2D(1.0f, 0.0f));
+    return devicePixelRatioF() / a.distanceToPoint(b);
+}
+
 QVector2D SiImageViewer::currentCursorPos() const
 {
     auto pos = mapFromGlobal(QCursor::pos());
@@ -25,12 +25,19 @@ SOFTWARE.
 #ifndef SIIMAGEVIEWER_H
 #define SIIMAGEVIEWER_H
 
+#include <QFutureWatcher>
 #include <QOpenGLFunctions>
 #include <QOpenGLFunctions_3_3_Core>
 #include <QOpenGLWidget>
 #include <QMatrix4x4>
+#include <QThreadPool>
+#include <QTimer>
 #include <QVector2D>
 #include <QVector4D>
+#include <memory>
+
+#include "siimagedecoder.h"
+#include "siimagestatistics.h"
 
 class SiImageViewer : public QOpenGLWidget, protected QOpenGLFunctions_3_3_Core
 {
@@ -46,6 +53,33 @@ public:
      */
     void setImage(const QImage& image);
 
+    /**
+     * @brief Updates a region of the main image. Only the changed region is uploaded
+     * and analyzed. An image set by a decoder is replaced as a whole, keeping the view.
+     * Behaves like setImage (resetting the view) if the size differs.
+     * @param image Updated image.
+     * @param rect Changed region in pixels.
+     */
+    void updateImage(const QImage& image, const QRect& rect);
+
+    /**
+     * @brief Sets the main image from a decoder. Only the resolution needed to
+     * fit the image into the widget is decoded. When zooming in, the visible
+     * region is refined in the background. Decoders without region support
+     * are decoded once at full resolution, like setImage.
+     * Statistics are approximate, computed from pixels at bounded resolution.
+     * @param decoder Decoder providing the image pixels.
+     * @return False if the image could not be decoded, the current image is kept.
+     */
+    bool setImageDecoder(std::shared_ptr<SiImageDecoder> decoder);
+
+    /**
+     * @brief Gets the statistics engine of the main image. It reports the
+     * statistics of the whole image and of the visible region via signals.
+     * @return Statistics engine owned by the viewer.
+     */
+    SiImageStatistics* statistics();
+
     /**
      * @brief Sets the background color of the viewer.
      * @param color Background color
@@ -89,6 +123,10 @@ protected:
     void keyReleaseEvent(QKeyEvent *event) override;
     void focusInEvent(QFocusEvent *event) override;
 
+private slots:
+    void viewSettled();
+    void detailDecoded();
+
 private:
     GLuint m_vertexShader;
     GLuint m_fragmentShader;
@@ -96,7 +134,8 @@ private:
     GLuint m_vao;
     GLuint m_vbo;
     GLuint m_ibo;
-    GLuint m_texture;
+    GLuint m_texture;       // whole image, possibly at reduced resolution
+    GLuint m_detailTexture; // visible region at the resolution needed by the view
 
     // Unifrom locations
     GLuint m_textureLocation;
@@ -111,6 +150,8 @@ private:
     QMatrix4x4 m_view;       // used for viewport transformation
     QMatrix4x4 m_projection; // not in use
     QMatrix4x4 m_mvp;        // multiplication of projection, view, model, pre
+    QMatrix4x4 m_lastMvp;    // MVP matrix of the last frame, used to detect view changes
+    QMatrix4x4 m_detailPre;  // used to transform the vertex coordinates to match the detail region
     QVector2D m_cursorPosImage;   // cursor position in image coordinates
     QVector2D m_originalMousePos; // cursor position on first mouse down
     QVector2D m_mouseDownPos;     // cursor position from mouse down event
@@ -123,6 +164,18 @@ private:
     bool m_ctrlDown;  // true when control is held down
     bool m_rDown;     // true when R is held down
 
+    std::shared_ptr<SiImageDecoder> m_decoder; // null if the image was set directly
+    QThreadPool m_decodePool;                  // detail decodes, not queued behind statistics
+    QFutureWatcher<QImage> m_detailWatcher;    // background decoding of the detail region
+    QTimer m_viewSettledTimer;                 // fires once the view stopped changing
+    SiImageStatistics m_statistics;            // histograms of the whole image and the visible region
+    bool m_detailPending{false}; // a detail decode is running, reset to discard its result
+    QRect m_detailRect;         // region of the detail texture (pixels, top-left origin)
+    QRect m_pendingDetailRect;  // region of the running decode
+    float m_baseScale{1.0f};    // base texture pixels per image pixel
+    float m_detailScale{0.0f};  // detail texture pixels per image pixel, 0 if there is none
+    float m_pendingDetailScale{0.0f}; // detail scale of the running decode
+
     void resetStates();
     void setupShaders();
     void setupBuffers();
@@ -131,6 +184,37 @@ private:
     void updateMatrices();
     void centerImage();
 
+    /**
+     * @brief Replaces the image data and statistics without changing the view.
+     * @param image New image.
+     */
+    void replaceImage(const QImage& image);
+    void uploadTexture(GLuint texture, const QImage& image);
+    void releaseDetailTexture();
+
+    /**
+     * @brief Decodes the visible region if the loaded textures do not provide
+     * enough resolution for the current view.
+     */
+    void refineVisibleRegion();
+
+    /**
+     * @brief Requests the statistics of the visible region.
+     */
+    void updateRegionStatistics();
+
+    /**
+     * @brief Gets the part of the image covered by the widget.
+     * @return Region in pixels with the origin at the top-left image corner.
+     */
+    QRect visibleImageRect();
+
+    /**
+     * @brief Gets the current zoom factor in physical screen pixels.
+     * @return Amount of screen pixels covered by one image pixel.
+     */
+    float screenPixelsPerImagePixel();
+
     /**
      * @brief Gets the current cursor position relative to the widget.
      * @return Relative cursor position